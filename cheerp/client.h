@@ -18,6 +18,8 @@
 #include <cheerpintrin.h>
 
 #ifndef LEAN_CXX_LIB
+#include <cstdint>
+#include <new>
 #include <utility>
 #endif
 
@@ -52,13 +54,54 @@ T&& forward(typename std::remove_reference<T>::type& t) noexcept
 	return static_cast<T&&>(t);
 }
 
+// Keeps the storage of up to SIZE destroyed functors of type T, so that
+// short-lived closures reuse it instead of allocating a new object. The
+// storage is typed, so every functor type has its own pool.
+template<class T>
+struct ClosurePool
+{
+	static constexpr int SIZE = 16;
+	static T* slots[SIZE];
+	static int count;
+	template<class F>
+	static T* acquire(F&& f)
+	{
+		if (count > 0)
+			return new (slots[--count]) T(::cheerp::forward<F>(f));
+		return new T(::cheerp::forward<F>(f));
+	}
+	static void release(T* t)
+	{
+		if (count < SIZE)
+		{
+			t->~T();
+			slots[count++] = t;
+		}
+		else
+			delete t;
+	}
+};
+template<class T>
+T* ClosurePool<T>::slots[ClosurePool<T>::SIZE];
+template<class T>
+int ClosurePool<T>::count = 0;
+
+// The trampolines receive the arguments by value from JavaScript, and then
+// move them into the functor. Reference parameters are passed through as
+// references, and the result is returned without an intermediate copy.
 template<class R>
 struct InvokeHelper
 {
 	template<class T, class... Args>
 	static R invoke(T* func, Args... args)
 	{
-		auto ret = (*func)(static_cast<Args&&>(args)...);
+		return (*func)(static_cast<Args&&>(args)...);
+	}
+	template<class T, class... Args>
+	static R invoke_once(T* func, Args... args)
+	{
+		R ret = (*func)(static_cast<Args&&>(args)...);
+		ClosurePool<T>::release(func);
 		return ret;
 	}
 };
@@ -71,33 +114,117 @@ struct InvokeHelper<void>
 	{
 		(*func)(static_cast<Args&&>(args)...);
 	}
+	template<class T, class... Args>
+	static void invoke_once(T* func, Args... args)
+	{
+		(*func)(static_cast<Args&&>(args)...);
+		ClosurePool<T>::release(func);
+	}
 };
 
+// Resources that escaped to JavaScript, together with the function that
+// frees them. Every resource gets a slot, and the slot index and generation
+// are stored on the resource itself, so freeing it does not need a lookup
+// and freeing it twice is ignored. When CHEERP_ESCAPED_FINALIZATION is
+// defined, resources are also freed when they are garbage collected.
 template<class R>
 struct EscapedResourcesList
 {
 	using deleter_t =  void(R*);
-	static client::Map* resources;
+	struct Slot
+	{
+		client::Object* deleter;
+		unsigned generation;
+		int next_free;
+	};
+	static Slot* slots;
+	static int capacity;
+	static int free_head;
+	static int live;
+#ifdef CHEERP_ESCAPED_FINALIZATION
+	static client::Object* registry;
+	static void finalize(client::Object* held)
+	{
+		int slot;
+		unsigned generation;
+		asm("%1.s" : "=r"(slot) : "r"(held));
+		asm("%1.g" : "=r"(generation) : "r"(held));
+		release(slot, generation, nullptr);
+	}
+#endif
+	static void grow()
+	{
+		int new_capacity = capacity ? capacity * 2 : 16;
+		Slot* new_slots = new Slot[new_capacity];
+		for (int i = 0; i < capacity; i++)
+			new_slots[i] = slots[i];
+		for (int i = capacity; i < new_capacity; i++)
+			new_slots[i] = Slot{nullptr, 0, i + 1 < new_capacity ? i + 1 : -1};
+		delete[] slots;
+		slots = new_slots;
+		free_head = capacity;
+		capacity = new_capacity;
+	}
+	static void release(int slot, unsigned generation, R* r)
+	{
+		if (slot < 0 || slot >= capacity || slots[slot].deleter == nullptr || slots[slot].generation != generation)
+			return;
+		client::Object* d = slots[slot].deleter;
+		slots[slot].deleter = nullptr;
+		slots[slot].generation += 1;
+		slots[slot].next_free = free_head;
+		free_head = slot;
+		live -= 1;
+		reinterpret_cast<deleter_t*>(d)(r);
+	}
 	static void add(R* r, client::Object* d)
 	{
-		if (resources == nullptr)
-			resources = new client::Map;
-		resources->set(r, d);
+		if (free_head < 0)
+			grow();
+		int slot = free_head;
+		unsigned generation = slots[slot].generation;
+		free_head = slots[slot].next_free;
+		slots[slot].deleter = d;
+		live += 1;
+		asm("%0.cheerpSlot=%1" : : "r"(r), "r"(slot));
+		asm("%0.cheerpGeneration=%1" : : "r"(r), "r"(generation));
+#ifdef CHEERP_ESCAPED_FINALIZATION
+		if (registry == nullptr)
+			asm("new FinalizationRegistry(%1)" : "=r"(registry) : "r"(__builtin_cheerp_make_complete_object<client::EventListener>(&finalize)));
+		asm("%0.register(%1,{s:%2,g:%3},%4)" : : "r"(registry), "r"(r), "r"(slot), "r"(generation), "r"(r));
+#endif
 	}
 	static void free(R* r)
 	{
-		if (resources == nullptr)
-			return;
-		client::Object* o = resources->get<R*, client::Object*>(r);
-		asm("%1===undefined?null:%2" : "=r"(o) : "r"(o),"r"(o));
-		if (o == nullptr)
+		int slot;
+		unsigned generation;
+		asm("%1.cheerpSlot===undefined?-1:%2.cheerpSlot" : "=r"(slot) : "r"(r), "r"(r));
+		if (slot < 0)
 			return;
-		resources->delete_(r);
-		reinterpret_cast<deleter_t*>(o)(r);
+		asm("%1.cheerpGeneration" : "=r"(generation) : "r"(r));
+#ifdef CHEERP_ESCAPED_FINALIZATION
+		if (registry != nullptr)
+			asm("%0.unregister(%1)" : : "r"(registry), "r"(r));
+#endif
+		release(slot, generation, r);
+	}
+	static int live_count()
+	{
+		return live;
 	}
 };
 template<class R>
-client::Map* EscapedResourcesList<R>::resources = nullptr;
+typename EscapedResourcesList<R>::Slot* EscapedResourcesList<R>::slots = nullptr;
+template<class R>
+int EscapedResourcesList<R>::capacity = 0;
+template<class R>
+int EscapedResourcesList<R>::free_head = -1;
+template<class R>
+int EscapedResourcesList<R>::live = 0;
+#ifdef CHEERP_ESCAPED_FINALIZATION
+template<class R>
+client::Object* EscapedResourcesList<R>::registry = nullptr;
+#endif
 
 using EscapedListeners = EscapedResourcesList<client::EventListener>;
 
@@ -106,6 +233,36 @@ inline void freeCallback(client::EventListener* e)
 	EscapedListeners::free(e);
 }
 
+inline int liveCallbackCount()
+{
+	return EscapedListeners::live_count();
+}
+
+// Plain function pointers of each signature are wrapped only once, so that
+// the same function pointer always maps to the same JavaScript function.
+// This makes a listener added with Callback(&f) removable with Callback(&f).
+template<class R, class... Args>
+struct FunctionPointerCache
+{
+	typedef R(func_t)(Args...);
+	static client::Object* cache;
+	static client::EventListener* get(func_t* f)
+	{
+		if (cache == nullptr)
+			asm("new Map()" : "=r"(cache));
+		client::EventListener* e;
+		asm("%1.get(%2)||null" : "=r"(e) : "r"(cache), "r"(f));
+		if (e == nullptr)
+		{
+			e = __builtin_cheerp_make_complete_object<client::EventListener>(f);
+			asm("%0.set(%1,%2)" : : "r"(cache), "r"(f), "r"(e));
+		}
+		return e;
+	}
+};
+template<class R, class... Args>
+client::Object* FunctionPointerCache<R, Args...>::cache = nullptr;
+
 template<class>
 class Closure;
 template<class R, class... Args>
@@ -113,6 +270,7 @@ class Closure<R(Args...)>
 {
 	client::EventListener* inner;
 	void(*deleter)(void*);
+	client::Object*(*make_deleter)(void*);
 	void* obj;
 
 	typedef R(func_t)(Args...);
@@ -139,51 +297,57 @@ class Closure<R(Args...)>
 	template<class T>
 	static void do_delete(void* o)
 	{
-		T* t = reinterpret_cast<T*>(o);
-		delete t;
+		ClosurePool<T>::release(reinterpret_cast<T*>(o));
 	}
-	struct DeleterHelper
+	template<class T>
+	static void do_release(T* t)
 	{
-		void(*deleter)(void*);
-		void* obj;
-	};
-	static void deleter_helper(DeleterHelper* h)
+		ClosurePool<T>::release(t);
+	}
+	// The deleter of an escaped closure is bound directly to the typed
+	// functor, so that no intermediate object has to be allocated.
+	template<class T>
+	static client::Object* do_make_deleter(void* o)
 	{
-		h->deleter(h->obj);
+		return __builtin_cheerp_create_closure<client::Object>(&do_release<T>, reinterpret_cast<T*>(o));
 	}
 public:
-	Closure():inner(nullptr), deleter(nullptr), obj(nullptr)
+	Closure():inner(nullptr), deleter(nullptr), make_deleter(nullptr), obj(nullptr)
 	{
 	}
 	template<class F>
 	Closure(F&& f, _NConvertible<F>* = 0, _en_if<_must_destroy<F>>* = 0)
 	{
 		using FF = typename std::remove_cv<typename std::remove_reference<F>::type>::type;
-		FF* newf = new FF(::cheerp::forward<F>(f));
+		FF* newf = ClosurePool<FF>::acquire(::cheerp::forward<F>(f));
 		inner = __builtin_cheerp_create_closure<client::EventListener>(&InvokeHelper<R>::template invoke<FF, Args...>, newf);
 		deleter = &do_delete<FF>;
+		make_deleter = &do_make_deleter<FF>;
 		obj = newf;
 	}
 	template<class F>
 	Closure(F&& f, _NConvertible<F>* = 0, _en_if_not<_must_destroy<F>>* = 0)
 	{
-		using FF = typename std::remove_reference<F>::type;
+		using FF = typename std::remove_cv<typename std::remove_reference<F>::type>::type;
 		FF* newf = new FF(::cheerp::forward<F>(f));
 		inner = __builtin_cheerp_create_closure<client::EventListener>(&InvokeHelper<R>::template invoke<FF, Args...>, newf);
 		deleter = nullptr;
+		make_deleter = nullptr;
 		obj = newf;
 	}
 	template<class F>
 	Closure(F f, _Convertible<F>* = 0)
 	{
-		inner = __builtin_cheerp_make_complete_object<client::EventListener>((func_t*)f);
+		inner = FunctionPointerCache<R, Args...>::get((func_t*)f);
 		deleter = nullptr;
+		make_deleter = nullptr;
 		obj = nullptr;
 	}
 	Closure(R(*f)(Args...))
 	{
-		inner = __builtin_cheerp_make_complete_object<client::EventListener>(f);
+		inner = FunctionPointerCache<R, Args...>::get(f);
 		deleter = nullptr;
+		make_deleter = nullptr;
 		obj = nullptr;
 	}
 	Closure(const Closure&) = delete;
@@ -192,9 +356,11 @@ public:
 	{
 		inner = c.inner;
 		deleter = c.deleter;
+		make_deleter = c.make_deleter;
 		obj = c.obj;
 		c.inner = nullptr;
 		c.deleter = nullptr;
+		c.make_deleter = nullptr;
 		c.obj = nullptr;
 	}
 	Closure& operator=(Closure&& c)
@@ -207,15 +373,18 @@ public:
 		}
 		inner = c.inner;
 		deleter = c.deleter;
+		make_deleter = c.make_deleter;
 		obj = c.obj;
 		c.inner = nullptr;
 		c.deleter = nullptr;
+		c.make_deleter = nullptr;
 		c.obj = nullptr;
 		return *this;
 	}
-	R operator()(Args&&... args)
+	template<class... CallArgs>
+	R operator()(CallArgs&&... args)
 	{
-		return reinterpret_cast<func_t*>(inner)(::cheerp::forward<Args>(args)...);
+		return reinterpret_cast<func_t*>(inner)(::cheerp::forward<CallArgs>(args)...);
 	}
 	operator bool()
 	{
@@ -225,9 +394,7 @@ public:
 	{
 		if (deleter)
 		{
-			DeleterHelper* h = new DeleterHelper{deleter, obj};
-			auto* d = __builtin_cheerp_create_closure<client::Object>(&deleter_helper, h);
-			EscapedListeners::add(inner, d);
+			EscapedListeners::add(inner, make_deleter(obj));
 			deleter = nullptr;
 		}
 		return inner;
@@ -256,6 +423,12 @@ struct ClosureHelper<T, R(C::*)(Args...) const>
 	{
 		return Closure<func_type>(::cheerp::forward<T>(func));
 	}
+	static client::EventListener* make_once(T&& func)
+	{
+		using FF = typename std::remove_cv<typename std::remove_reference<T>::type>::type;
+		FF* newf = ClosurePool<FF>::acquire(::cheerp::forward<T>(func));
+		return __builtin_cheerp_create_closure<client::EventListener>(&InvokeHelper<R>::template invoke_once<FF, Args...>, newf);
+	}
 };
 template<class T, class C, class R, class... Args>
 struct ClosureHelper<T, R(C::*)(Args...)>
@@ -265,6 +438,12 @@ struct ClosureHelper<T, R(C::*)(Args...)>
 	{
 		return Closure<func_type>(::cheerp::forward<T>(func));
 	}
+	static client::EventListener* make_once(T&& func)
+	{
+		using FF = typename std::remove_cv<typename std::remove_reference<T>::type>::type;
+		FF* newf = ClosurePool<FF>::acquire(::cheerp::forward<T>(func));
+		return __builtin_cheerp_create_closure<client::EventListener>(&InvokeHelper<R>::template invoke_once<FF, Args...>, newf);
+	}
 };
 
 template<class T>
@@ -314,6 +493,27 @@ client::_Function<R(Args...)>* Callback2(R (*func)(Args...))
 	return Closure<R(Args...)>(func);
 }
 
+/**
+ * Adapter from C++ functors and lambdas to code callable from JavaScript exactly once, for example by setTimeout or Promise::then
+ * The functor is destroyed right after the first invocation, without registering it in EscapedListeners.
+ * If the callback is never invoked, the functor is leaked.
+ */
+template<class T>
+client::EventListener* OnceCallback(T&& func)
+{
+	typedef ClosureHelper<T, decltype(&std::remove_reference<T>::type::operator())> closure_helper;
+	return closure_helper::make_once(::cheerp::forward<T>(func));
+}
+/**
+ * Adapter from C++ functions to code callable from JavaScript exactly once
+ * Functions have no state to destroy, so this is the same as Callback.
+ */
+template<class R, class... Args>
+client::EventListener* OnceCallback(R (*func)(Args...))
+{
+	return Closure<R(Args...)>(func);
+}
+
 template<typename T>
 struct TypedArrayForPointerType;
 
@@ -365,6 +565,40 @@ struct TypedArrayForPointerType<double>
 	typedef client::Float64Array type;
 };
 
+// Small direct-mapped cache of the views created by MakeTypedArray and
+// MakeArrayBufferView, so that repeatedly viewing the same range does not
+// allocate a new JavaScript object every time. Entries are keyed by the typed
+// array that backs the memory, which is replaced when linear memory grows, so
+// stale views are never returned. Offsets are in bytes and lengths in
+// elements of T.
+template<class T>
+struct TypedViewCache
+{
+	static constexpr int SIZE = 16;
+	struct Entry
+	{
+		client::Object* base;
+		size_t offset;
+		size_t length;
+		T* view;
+	};
+	static Entry entries[SIZE];
+	static Entry& lookup(client::Object* base, size_t offset, size_t length)
+	{
+		return entries[(offset ^ (length * 7)) & (SIZE - 1)];
+	}
+	template<class F>
+	static T* get(client::Object* base, size_t offset, size_t length, F&& make)
+	{
+		Entry& e = lookup(base, offset, length);
+		if (e.view == nullptr || e.base != base || e.offset != offset || e.length != length)
+			e = Entry{base, offset, length, make()};
+		return e.view;
+	}
+};
+template<class T>
+typename TypedViewCache<T>::Entry TypedViewCache<T>::entries[TypedViewCache<T>::SIZE];
+
 template<typename P,typename T=typename TypedArrayForPointerType<P>::type>
 T* MakeTypedArray(const P* ptr, size_t size=0)
 {
@@ -372,9 +606,14 @@ T* MakeTypedArray(const P* ptr, size_t size=0)
 	T* buf=__builtin_cheerp_make_complete_object<T>(__builtin_cheerp_pointer_base<T>(ptr));
 	size_t elementSize=sizeof(P);
 	if(size==0)
-		return offset==0 ? buf : buf->subarray(offset);
-	else
-		return offset==0 && buf->get_length()==size/elementSize ? buf : buf->subarray(offset, offset+size/elementSize);
+	{
+		if(offset==0)
+			return buf;
+		return TypedViewCache<T>::get(buf, offset*elementSize, SIZE_MAX, [&]() { return buf->subarray(offset); });
+	}
+	if(offset==0 && buf->get_length()==size/elementSize)
+		return buf;
+	return TypedViewCache<T>::get(buf, offset*elementSize, size/elementSize, [&]() { return buf->subarray(offset, offset+size/elementSize); });
 }
 
 template<typename T>
@@ -385,11 +624,11 @@ T* MakeTypedArray(const void* ptr, size_t size=0)
 	client::Int8Array* buf=__builtin_cheerp_make_complete_object<client::Int8Array>(__builtin_cheerp_pointer_base<client::Int8Array>(ptr));
 	size_t elementSize=buf->get_BYTES_PER_ELEMENT();
 	if(size==0)
-		return new T(buf->get_buffer(), offset*elementSize);
+		return TypedViewCache<T>::get(buf, offset*elementSize, SIZE_MAX, [&]() { return new T(buf->get_buffer(), offset*elementSize); });
 	else
 	{
 		size_t newElementSize = sizeof((*((T*)nullptr))[0]);
-		return new T(buf->get_buffer(), offset*elementSize, size/newElementSize);
+		return TypedViewCache<T>::get(buf, offset*elementSize, size/newElementSize, [&]() { return new T(buf->get_buffer(), offset*elementSize, size/newElementSize); });
 	}
 }
 
@@ -400,9 +639,75 @@ inline client::ArrayBufferView* MakeArrayBufferView(const void* ptr, size_t size
 	client::Int8Array* buf=__builtin_cheerp_make_complete_object<client::Int8Array>(__builtin_cheerp_pointer_base<client::Int8Array>(ptr));
 	size_t elementSize=buf->get_BYTES_PER_ELEMENT();
 	if(size==0)
-		return offset==0 ? buf : buf->subarray(offset);
-	else
-		return offset==0 && buf->get_length()==size/elementSize ? buf : buf->subarray(offset, offset+size/elementSize);
+	{
+		if(offset==0)
+			return buf;
+		return TypedViewCache<client::ArrayBufferView>::get(buf, offset, SIZE_MAX, [&]() { return buf->subarray(offset); });
+	}
+	if(offset==0 && buf->get_length()==size/elementSize)
+		return buf;
+	return TypedViewCache<client::ArrayBufferView>::get(buf, offset, size/elementSize, [&]() { return buf->subarray(offset, offset+size/elementSize); });
+}
+
+/**
+ * Reusable handle to a typed array view of C++ memory
+ * JavaScript typed arrays cannot be re-pointed, so reset to a new range allocates a new view.
+ * Only ranges that are still in the view cache of MakeTypedArray are reused without allocating.
+ */
+template<typename P,typename T=typename TypedArrayForPointerType<P>::type>
+class TypedView
+{
+private:
+	T* view;
+public:
+	TypedView():view(nullptr)
+	{
+	}
+	TypedView(const P* ptr, size_t size=0):view(MakeTypedArray<P, T>(ptr, size))
+	{
+	}
+	void reset(const P* ptr, size_t size=0)
+	{
+		view = MakeTypedArray<P, T>(ptr, size);
+	}
+	T* get() const
+	{
+		return view;
+	}
+	T* operator->() const
+	{
+		return view;
+	}
+	operator T*() const
+	{
+		return view;
+	}
+};
+
+/**
+ * Copy count elements from C++ memory into a typed array, starting at element dstOffset of the typed array
+ * The copy is a single native TypedArray.set over a view of the source.
+ */
+template<typename P,typename T=typename TypedArrayForPointerType<P>::type>
+void copyToTypedArray(T* dst, const P* src, size_t count, size_t dstOffset=0)
+{
+	if(count==0)
+		return;
+	T* view=MakeTypedArray<P, T>(src, count*sizeof(P));
+	asm("%0.set(%1,%2)" : : "r"(dst), "r"(view), "r"(dstOffset));
+}
+
+/**
+ * Copy count elements from a typed array into C++ memory, starting at element srcOffset of the typed array
+ * The copy is a single native TypedArray.set over a view of the destination.
+ */
+template<typename P,typename T=typename TypedArrayForPointerType<P>::type>
+void copyFromTypedArray(P* dst, T* src, size_t count, size_t srcOffset=0)
+{
+	if(count==0)
+		return;
+	T* view=MakeTypedArray<P, T>(dst, count*sizeof(P));
+	asm("%0.set(%1.subarray(%2,%3))" : : "r"(view), "r"(src), "r"(srcOffset), "r"(srcOffset+count));
 }
 
 // Helper class to access the [] operator on JS array-like objects
@@ -1,6 +1,7 @@
 #ifndef CHEERP_JSHELPER_H
 #define CHEERP_JSHELPER_H
 #include <type_traits>
+#include <string_view>
 namespace [[cheerp::genericjs]] client {
 	class Object;
 	class String;
@@ -70,7 +71,7 @@ namespace cheerp {
 	template<class T>
 	using ArrayElementTypeT = typename ArrayElementType<RemoveCvRefT<T>>::type;
 	template<bool Variadic, class From, class To>
-	constexpr bool IsAcceptableImplV = std::is_same_v<std::remove_pointer_t<RemoveCvRefT<To>>, client::_Any> || std::is_same_v<std::remove_pointer_t<RemoveCvRefT<From>>, client::_Any> || std::is_convertible_v<From, To> || std::is_convertible_v<From, const std::remove_pointer_t<To>&> || (Variadic && std::is_convertible_v<From, const char*> && std::is_same_v<To, client::String*>);
+	constexpr bool IsAcceptableImplV = std::is_same_v<std::remove_pointer_t<RemoveCvRefT<To>>, client::_Any> || std::is_same_v<std::remove_pointer_t<RemoveCvRefT<From>>, client::_Any> || std::is_convertible_v<From, To> || std::is_convertible_v<From, const std::remove_pointer_t<To>&> || (Variadic && (std::is_convertible_v<From, const char*> || std::is_convertible_v<From, std::string_view>) && std::is_same_v<To, client::String*>);
 	template<bool Variadic, class From, class To>
 	struct IsAcceptable {
 		constexpr static bool value = IsAcceptableImplV<Variadic, From, To>;
@@ -103,13 +104,21 @@ namespace cheerp {
 	}
 	[[cheerp::genericjs, gnu::always_inline]]
 	inline client::String* makeString(const char* str);
+	[[cheerp::genericjs, gnu::always_inline]]
+	inline client::String* makeString(std::string_view str);
+	template<class T>
+	constexpr bool IsStringV = std::is_same_v<RemoveCvRefT<T>, char*> || std::is_same_v<RemoveCvRefT<T>, std::string_view> || (std::is_class_v<RemoveCvRefT<T>> && std::is_convertible_v<T, std::string_view>);
 	template<class T>
 	[[cheerp::genericjs, gnu::always_inline]]
-	std::conditional_t<std::is_same_v<std::remove_cv_t<std::remove_reference_t<T>>, char*>, client::String*, T&&> clientCast(T&& value) {
-		if constexpr (std::is_same_v<std::remove_cv_t<std::remove_reference_t<T>>, char*>)
+	std::conditional_t<IsStringV<T>, client::String*, T&&> clientCast(T&& value) {
+		if constexpr (IsStringV<T>)
 			return makeString(value);
 		else
 			return value;
 	}
 }
+// Convert a string literal to a `client::String*` only once, the first time
+// that the expression is evaluated, and reuse the same string afterwards.
+// The empty literal makes sure that the argument is a string literal.
+#define CHEERP_STR(str) ({ struct [[cheerp::genericjs]] CheerpStr { [[gnu::always_inline]] static client::String* get() { static client::String* s; if (s == nullptr) s = cheerp::makeString("" str); return s; } }; CheerpStr::get(); })
 #endif
@@ -49,7 +49,7 @@ export abstract class Declaration extends Namespace {
 		return this.state;
 	}
 
-	public setState(state: State): void {
+	public setState(state?: State): void {
 		this.state = state;
 	}
 
@@ -3,7 +3,7 @@ import { Function } from "./function.js";
 import { Variable } from "./variable.js";
 import { Class, Visibility } from "./class.js";
 import { Type, DeclaredType, NamedType, QualifiedType, TypeQualifier, TemplateType } from "./type.js";
-import { LONG_TYPE, UNSIGNED_LONG_TYPE, INT_TYPE, UNSIGNED_INT_TYPE, CONST_CHAR_POINTER_TYPE, SIZE_TYPE, STRING_TYPE, DOUBLE_TYPE, VOID_TYPE, BOOL_TYPE, ANY_TYPE } from "./types.js";
+import { LONG_TYPE, UNSIGNED_LONG_TYPE, INT_TYPE, UNSIGNED_INT_TYPE, CHAR_TYPE, CONST_CHAR_POINTER_TYPE, SIZE_TYPE, STRING_TYPE, STRING_VIEW_TYPE, DOUBLE_TYPE, VOID_TYPE, BOOL_TYPE, ANY_TYPE } from "./types.js";
 import { Parser } from "./parser.js";
 import { Library } from "./library.js";
 import { State } from "./target.js";
@@ -36,69 +36,109 @@ function addStringExtensions(parser: Parser, stringClass: Class): void {
 	addConversionConstructor(stringClass, UNSIGNED_INT_TYPE);
 	addConversionConstructor(stringClass, DOUBLE_TYPE);
 
+	// The length and the ASCII check are computed in the same pass, so the
+	// input is only scanned once before it is decoded.
 	const fromUtf8 = new Function("fromUtf8", stringType.pointer());
 	fromUtf8.addAttribute("gnu::always_inline");
 	fromUtf8.addFlags(Flags.Static);
 	fromUtf8.addParameter(CONST_CHAR_POINTER_TYPE, "in");
 	fromUtf8.addParameter(SIZE_TYPE, "len", "SIZE_MAX");
 	fromUtf8.setBody(`
-client::String* out = new client::String();
-unsigned int cp;
-for (std::size_t i = 0; i < len && in[i];) {
-	unsigned char ch = in[i++];
-	cp =
-		ch < 0x80 ? ch :
-		ch < 0xc0 ? cp << 6 | (ch & 0x3f) :
-		ch < 0xe0 ? ch & 0x1f :
-		ch < 0xf0 ? ch & 0x0f : ch & 0x07;
-	if (i == len || (in[i] & 0xc0) != 0x80) {
-		if (cp <= 0xffff) {
-			out = out->concat(fromCharCode(cp));
-		} else {
-			out = out->concat(fromCharCode((cp - 0x10000) >> 10 | 0xd800));
-			out = out->concat(fromCharCode((cp & 0x3ff) | 0xdc00));
-		}
+std::size_t n = 0;
+bool ascii = true;
+while (n < len && in[n]) {
+	ascii &= static_cast<unsigned char>(in[n]) < 0x80;
+	n++;
+}
+return decodeUtf8(in, n, ascii);
+	`);
+
+	const fromUtf8View = new Function("fromUtf8", stringType.pointer());
+	fromUtf8View.addAttribute("gnu::always_inline");
+	fromUtf8View.addFlags(Flags.Static);
+	fromUtf8View.addParameter(STRING_VIEW_TYPE, "in");
+	fromUtf8View.setBody(`
+bool ascii = true;
+for (std::size_t i = 0; i < in.size(); i++) {
+	ascii &= static_cast<unsigned char>(in[i]) < 0x80;
+}
+return decodeUtf8(in.data(), in.size(), ascii);
+	`);
+
+	// The input is decoded in bulk from a view of its typed array. ASCII input
+	// is converted in chunks, to stay below the argument count limit of
+	// `apply`. Other input is copied with `slice`, because `TextDecoder`
+	// does not accept views of shared memory.
+	const decodeUtf8 = new Function("decodeUtf8", stringType.pointer());
+	decodeUtf8.addFlags(Flags.Static);
+	decodeUtf8.addParameter(CONST_CHAR_POINTER_TYPE, "in");
+	decodeUtf8.addParameter(SIZE_TYPE, "n");
+	decodeUtf8.addParameter(BOOL_TYPE, "ascii");
+	decodeUtf8.setBody(`
+if (n == 0) {
+	return new client::String();
+}
+client::Object* base = __builtin_cheerp_pointer_base<client::Object>(in);
+std::size_t offset = __builtin_cheerp_pointer_offset(in);
+client::String* out;
+if (ascii) {
+	out = new client::String();
+	for (std::size_t i = 0; i < n; i += 0x2000) {
+		std::size_t end = n - i < 0x2000 ? n : i + 0x2000;
+		client::String* chunk;
+		__asm__("String.fromCharCode.apply(null,%1.subarray(%2,%3))" : "=r"(chunk) : "r"(base), "r"(offset + i), "r"(offset + end));
+		out = out->concat(chunk);
 	}
+} else {
+	__asm__("new TextDecoder().decode(%1.slice(%2,%3))" : "=r"(out) : "r"(base), "r"(offset), "r"(offset + n));
 }
 return out;
 	`);
 
+	// The result is at most 3 bytes per UTF-16 code unit, so the string is
+	// sized once and encoded into its storage with a single call.
 	const toUtf8 = new Function("toUtf8", STRING_TYPE);
 	toUtf8.addFlags(Flags.Const);
 	toUtf8.setBody(`
 std::string out;
 std::size_t len = get_length();
-unsigned int cp;
-for (std::size_t i = 0; i < len;) {
-	unsigned int ch = charCodeAt(i++);
-	cp =
-		ch < 0xd800 || ch > 0xdfff ? ch :
-		ch < 0xdc00 ? (ch & 0x3ff) << 10 : (cp | (ch & 0x3ff)) + 0x10000;
-	if (i == len || (ch & 0xdc00) != 0xd800) {
-		if (cp <= 0x7f) {
-			out.push_back(cp);
-		} else if (cp <= 0x7ff) {
-			out.push_back(0xc0 | cp >> 6);
-			out.push_back(0x80 | (cp & 0x3f));
-		} else if (cp <= 0xffff) {
-			out.push_back(0xe0 | cp >> 12);
-			out.push_back(0x80 | (cp >> 6 & 0x3f));
-			out.push_back(0x80 | (cp & 0x3f));
-		} else {
-			out.push_back(0xf0 | cp >> 18);
-			out.push_back(0x80 | (cp >> 12 & 0x3f));
-			out.push_back(0x80 | (cp >> 6 & 0x3f));
-			out.push_back(0x80 | (cp & 0x3f));
-		}
-	}
+if (len == 0) {
+	return out;
 }
+out.resize(len * 3);
+out.resize(toUtf8(&out[0], out.size()));
 return out;
 	`);
 
+	// Encode into `dst` without allocating, and return the number of bytes
+	// written. If `cap` is too small, the output is truncated at a character
+	// boundary.
+	const toUtf8Buffer = new Function("toUtf8", SIZE_TYPE);
+	toUtf8Buffer.addFlags(Flags.Const);
+	toUtf8Buffer.addParameter(CHAR_TYPE.pointer(), "dst");
+	toUtf8Buffer.addParameter(SIZE_TYPE, "cap");
+	toUtf8Buffer.setBody(`
+client::Object* base = __builtin_cheerp_pointer_base<client::Object>(dst);
+std::size_t offset = __builtin_cheerp_pointer_offset(dst);
+std::size_t written;
+__asm__("new TextEncoder().encodeInto(%1,new Uint8Array(%2.buffer,%3.byteOffset+%4,%5)).written" : "=r"(written) : "r"(this), "r"(base), "r"(base), "r"(offset), "r"(cap));
+return written;
+	`);
+
 	const charConstructor = new Function(stringClass.getName());
 	charConstructor.addParameter(CONST_CHAR_POINTER_TYPE, "x");
 	charConstructor.addInitializer(stringClass.getName(), "fromUtf8(x)");
 	charConstructor.setBody(``);
+
+	const stringViewConstructor = new Function(stringClass.getName());
+	stringViewConstructor.addParameter(STRING_VIEW_TYPE, "x");
+	stringViewConstructor.addInitializer(stringClass.getName(), "fromUtf8(x)");
+	stringViewConstructor.setBody(``);
+
+	const stdStringConstructor = new Function(stringClass.getName());
+	stdStringConstructor.addParameter(STRING_TYPE.constReference(), "x");
+	stdStringConstructor.addInitializer(stringClass.getName(), "fromUtf8(std::string_view(x))");
+	stdStringConstructor.setBody(``);
 	
 	const stringConversion = new Function("operator std::string");
 	stringConversion.addFlags(Flags.Const | Flags.Explicit);
@@ -107,8 +147,13 @@ return this->toUtf8();
 	`);
 
 	stringClass.addMember(fromUtf8, Visibility.Public);
+	stringClass.addMember(fromUtf8View, Visibility.Public);
+	stringClass.addMember(decodeUtf8, Visibility.Private);
 	stringClass.addMember(toUtf8, Visibility.Public);
+	stringClass.addMember(toUtf8Buffer, Visibility.Public);
 	stringClass.addMember(charConstructor, Visibility.Public);
+	stringClass.addMember(stringViewConstructor, Visibility.Public);
+	stringClass.addMember(stdStringConstructor, Visibility.Public);
 	stringClass.addMember(stringConversion, Visibility.Public);
 
 	const cheerpNamespace = new Namespace("cheerp");
@@ -118,7 +163,12 @@ return this->toUtf8();
 	makeStringFunc.addParameter(CONST_CHAR_POINTER_TYPE, "str");
 	makeStringFunc.setBody(`return new client::String(str);`);
 
+	const makeStringViewFunc = new Function("makeString", stringType.pointer(), cheerpNamespace);
+	makeStringViewFunc.addParameter(STRING_VIEW_TYPE, "str");
+	makeStringViewFunc.setBody(`return client::String::fromUtf8(str);`);
+
 	parser.getLibrary().addGlobal(makeStringFunc);
+	parser.getLibrary().addGlobal(makeStringViewFunc);
 }
 
 function addNumberExtensions(parser: Parser, numberClass: Class): void {
@@ -339,6 +389,7 @@ export function addExtensions(parser: Parser): void {
 	const clientlibFile = library.getFile("cheerp/clientlib.h")!;
 
 	typesFile.addInclude("string", true);
+	typesFile.addInclude("string_view", true);
 	jsobjectFile.addInclude("cstddef", true);
 	jsobjectFile.addInclude("cstdint", true);
 
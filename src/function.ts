@@ -3,6 +3,7 @@ import { Namespace, Flags } from "./namespace.js";
 import { State, Dependency, Dependencies, ReasonKind } from "./target.js";
 import { Writer } from "./writer.js";
 import { Type } from "./type.js";
+import { useOutOfLine } from "./options.js";
 
 export class Parameter {
 	private type: Type;
@@ -130,41 +131,25 @@ export class Function extends TemplateDeclaration {
 		);
 	}
 
-	public write(writer: Writer, state: State, namespace?: Namespace): void {
-		const flags = this.getFlags();
-		let first = true;
-		this.writeTemplate(writer);
-
-		if (this.body === undefined) {
-			this.writeInterfaceName(writer);
-		}
-
-		if (this.getAttributes().length > 0) {
-			this.writeAttributes(writer);
-			writer.writeLine(false);
+	// With `--out-of-line`, functions with a body longer than one line are
+	// only declared in the header, and defined in the companion source file.
+	// This is not possible for templates and members of class templates.
+	public isOutOfLine(): boolean {
+		if (!useOutOfLine() || this.body === undefined || !this.body.trim().includes("\n") || this.getTypeParameters().length > 0) {
+			return false;
 		}
 
-		if (flags & Flags.Explicit) {
-			writer.write("explicit");
-			writer.writeSpace();
-		}
-
-		if (flags & Flags.Static) {
-			writer.write("static");
-			writer.writeSpace();
-		}
-
-		if (flags & Flags.Inline) {
-			writer.write("inline");
-			writer.writeSpace();
+		for (let parent = this.getParentDeclaration(); parent; parent = parent.getParentDeclaration()) {
+			if (parent instanceof TemplateDeclaration && parent.getTypeParameters().length > 0) {
+				return false;
+			}
 		}
 
-		if (this.type) {
-			this.type.write(writer, namespace);
-			writer.writeSpace();
-		}
+		return true;
+	}
 
-		writer.write(this.getName());
+	private writeParameters(writer: Writer, namespace: Namespace | undefined, defaultValues: boolean): void {
+		let first = true;
 		writer.write("(");
 
 		for (const parameter of this.parameters) {
@@ -179,7 +164,7 @@ export class Function extends TemplateDeclaration {
 			writer.writeSpace();
 			writer.write(parameter.getName());
 
-			if (defaultValue) {
+			if (defaultValue && defaultValues) {
 				writer.writeSpace(false);
 				writer.write("=");
 				writer.writeSpace(false);
@@ -191,12 +176,14 @@ export class Function extends TemplateDeclaration {
 
 		writer.write(")");
 
-		if (flags & Flags.Const) {
+		if (this.getFlags() & Flags.Const) {
 			writer.writeSpace(false);
 			writer.write("const");
 		}
+	}
 
-		first = true;
+	private writeInitializers(writer: Writer): void {
+		let first = true;
 
 		for (const initializer of this.initializers) {
 			writer.write(first ? ":" : ",");
@@ -207,8 +194,52 @@ export class Function extends TemplateDeclaration {
 			writer.write(")");
 			first = false;
 		}
+	}
+
+	public write(writer: Writer, state: State, namespace?: Namespace): void {
+		const flags = this.getFlags();
+		const outOfLine = this.isOutOfLine();
+		this.writeTemplate(writer);
 
-		if (this.body !== undefined) {
+		if (this.body === undefined) {
+			this.writeInterfaceName(writer);
+		}
+
+		// `gnu::always_inline` has no effect when the definition is in a
+		// different translation unit.
+		const attributes = this.getAttributes()
+			.filter(attribute => !outOfLine || attribute !== "gnu::always_inline");
+
+		if (attributes.length > 0) {
+			this.writeAttributes(writer, attributes);
+			writer.writeLine(false);
+		}
+
+		if (flags & Flags.Explicit) {
+			writer.write("explicit");
+			writer.writeSpace();
+		}
+
+		if (flags & Flags.Static) {
+			writer.write("static");
+			writer.writeSpace();
+		}
+
+		if ((flags & Flags.Inline) && !outOfLine) {
+			writer.write("inline");
+			writer.writeSpace();
+		}
+
+		if (this.type) {
+			this.type.write(writer, namespace);
+			writer.writeSpace();
+		}
+
+		writer.write(this.getName());
+		this.writeParameters(writer, namespace, true);
+
+		if (this.body !== undefined && !outOfLine) {
+			this.writeInitializers(writer);
 			writer.writeBody(this.body);
 		} else {
 			writer.write(";");
@@ -216,6 +247,21 @@ export class Function extends TemplateDeclaration {
 		}
 	}
 
+	// Write the out-of-line definition of this function, at the scope of
+	// `namespace`. Default arguments, `explicit` and `static` are only
+	// allowed on the declaration.
+	public writeDefinition(writer: Writer, namespace?: Namespace): void {
+		if (this.type) {
+			this.type.write(writer, namespace);
+			writer.writeSpace();
+		}
+
+		writer.write(this.getPath(namespace));
+		this.writeParameters(writer, namespace, false);
+		this.writeInitializers(writer);
+		writer.writeBody(this.body ?? "");
+	}
+
 	public key(): string {
 		const flags = (this.getFlags() & Flags.Const) ? "C" : "M";
 		const parameterKey = this.parameters
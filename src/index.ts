@@ -1,9 +1,11 @@
 import { Parser } from "./parser.js";
 import { catchErrors } from "./error.js";
 import { Library } from "./library.js";
+import { getUsedDeclarations } from "./usage.js";
 import { program } from "commander";
-import { Timer, options, parseOptions } from "./options.js";
+import { Timer, options, parseOptions, useDefaultLib, getLibs, getUsedBy, getRoots } from "./options.js";
 import * as ts from "typescript";
+import * as fs from "fs";
 
 // TODO: generate function types for classes that only have a call signature
 
@@ -58,29 +60,80 @@ const DEFAULTLIB_FILES = [
 	"node_modules/typescript/lib/lib.scripthost.d.ts",
 ];
 
+// Resolve the files of the typescript libs in `names`, and of the libs that
+// they reference with `/// <reference lib="..." />`, dependencies first.
+function getLibFiles(names: ReadonlyArray<string>): Array<string> {
+	const files = new Array<string>;
+
+	const addLib = (name: string) => {
+		const file = `node_modules/typescript/lib/lib.${name.toLowerCase()}.d.ts`;
+
+		if (files.includes(file)) {
+			return;
+		}
+
+		if (!fs.existsSync(file)) {
+			program.error(`error: unknown lib [${name}]`);
+		}
+
+		for (const reference of ts.preProcessFile(fs.readFileSync(file, "utf-8")).libReferenceDirectives) {
+			addLib(reference.fileName);
+		}
+
+		if (!files.includes(file)) {
+			files.push(file);
+		}
+	};
+
+	for (const name of names) {
+		addLib(name);
+	}
+
+	return files;
+}
+
 parseOptions();
 
-if (options.defaultLib) {
+const libs = getLibs();
+
+if (libs) {
+	program.args.push(...getLibFiles(libs));
+} else if (useDefaultLib()) {
 	program.args.push(...DEFAULTLIB_FILES);
 }
 
-const createProgramTimer = new Timer("create program");
-const tsProgram = ts.createProgram(program.args, {});
-createProgramTimer.end();
+// The typescript program and the parser are only referenced from inside this
+// function, so that they can be garbage collected before the output is
+// written.
+function parse(library: Library): void {
+	const createProgramTimer = new Timer("create program");
+	// With `--lib`, all lib files are passed explicitly, so the default lib
+	// of the compiler must not be loaded as well.
+	const tsProgram = ts.createProgram(program.args, { noLib: !!libs });
+	createProgramTimer.end();
 
-const library = new Library(options.O ?? "cheerp/clientlib.h", program.args);
-
-if (options.listFiles) {
 	for (const sourceFile of tsProgram.getSourceFiles()) {
-		console.log(sourceFile.fileName);
+		library.addInputFile(sourceFile.fileName);
 	}
+
+	if (options.listFiles) {
+		for (const sourceFile of tsProgram.getSourceFiles()) {
+			console.log(sourceFile.fileName);
+		}
+	}
+
+	const parseTimer = new Timer("parse");
+	new Parser(tsProgram, library, useDefaultLib());
+	parseTimer.end();
 }
 
+const library = new Library(options.O ?? "cheerp/clientlib.h", program.args);
+
 let writerOptions = {
 	pretty: options.pretty,
 };
 
-if (options.defaultLib) {
+if (useDefaultLib()) {
 	const jsobjectFile = library.addFile("cheerp/jsobject.h");
 	const typesFile = library.addFile("cheerp/types.h");
 	const clientlibFile = library.getDefaultFile();
@@ -101,9 +154,16 @@ if (options.defaultLib) {
 	library.addGlobalInclude("cheerp/clientlib.h", true);
 }
 
-const parseTimer = new Timer("parse");
-const parser = new Parser(tsProgram, library, options.defaultLib);
-parseTimer.end();
+parse(library);
+
+const usedBy = getUsedBy();
+const roots = getRoots();
+
+if (usedBy || roots.length > 0) {
+	const usageTimer = new Timer("usage");
+	library.restrict(getUsedDeclarations(library, usedBy, roots));
+	usageTimer.end();
+}
 
 catchErrors(() => {
 	const writeTimer = new Timer("write");
@@ -1,8 +1,15 @@
-import { Declaration } from "./declaration.js";
+import { Declaration, TemplateDeclaration } from "./declaration.js";
 import { State, Target, resolveDependencies, removeDuplicates } from "./target.js";
-import { Options, StreamWriter } from "./writer.js";
+import { Options, OutputWriter, StringWriter } from "./writer.js";
 import { Namespace } from "./namespace.js";
+import { Class } from "./class.js";
+import { Function } from "./function.js";
+import { Variable } from "./variable.js";
+import { TypeAlias } from "./typeAlias.js";
+import { Expression, TemplateType, DeclaredType } from "./type.js";
+import { options, isVerbose, useConstraints, useSplit, usePch, useOutOfLine, getExternTemplateCount, getShardCount, getDepfile, getModuleName } from "./options.js";
 import * as fs from "fs";
+import * as path from "path";
 
 const REALPATH_CACHE = new Map;
 
@@ -17,8 +24,40 @@ function realpath(file: string): string {
 	return result;
 }
 
+// The top-level class or namespace that contains a declaration, in split mode
+// every one of these is written to its own file.
+function getUnit(declaration: Declaration): Namespace {
+	const depth = options.namespace ? 2 : 1;
+	let unit: Namespace = declaration;
+
+	while (unit.getDepth() > depth) {
+		unit = unit.getParent()!;
+	}
+
+	return unit;
+}
+
+function getBaseName(file: File): string {
+	return file.getName().replace(/\.[^\/.]*$/, "");
+}
+
+function getRelativePath(from: string, to: string): string {
+	return path.posix.relative(path.posix.dirname(from), to);
+}
+
+function getDescendants(declaration: Declaration, descendants: Array<Declaration> = new Array): Array<Declaration> {
+	descendants.push(declaration);
+
+	for (const child of declaration.getChildren()) {
+		getDescendants(child, descendants);
+	}
+
+	return descendants;
+}
+
 export class Global implements Target {
 	private readonly declaration: Declaration;
+	private targetState?: State;
 
 	public constructor(declaration: Declaration) {
 		this.declaration = declaration;
@@ -29,7 +68,11 @@ export class Global implements Target {
 	}
 
 	public getTargetState(): State {
-		return this.declaration.maxState();
+		return this.targetState ?? this.declaration.maxState();
+	}
+
+	public setTargetState(state: State): void {
+		this.targetState = state;
 	}
 }
 
@@ -61,6 +104,7 @@ export class File {
 	private readonly name: string;
 	private readonly includes: Array<Include> = new Array;
 	private readonly names: Array<string> = new Array;
+	private readonly forwardDeclarations: Set<Declaration> = new Set;
 
 	public constructor(name: string) {
 		this.name = name;
@@ -78,6 +122,10 @@ export class File {
 		this.includes.push(new Include(name, system, file));
 	}
 
+	public includesFile(file: File): boolean {
+		return this.includes.some(include => include.getFile() === file);
+	}
+
 	public getNames(): ReadonlyArray<string> {
 		return this.names;
 	}
@@ -85,16 +133,24 @@ export class File {
 	public addName(name: string): void {
 		this.names.push(name);
 	}
+
+	public getForwardDeclarations(): ReadonlySet<Declaration> {
+		return this.forwardDeclarations;
+	}
+
+	public addForwardDeclaration(declaration: Declaration): void {
+		this.forwardDeclarations.add(declaration);
+	}
 }
 
 export class FileWriter {
 	private readonly file: File;
-	private readonly writer: StreamWriter;
+	private readonly writer: OutputWriter;
 	private namespace?: Namespace;
 	private targetCount: number = 0;
 	private resolveCount: number = 0;
 
-	public constructor(file: File, writer: StreamWriter) {
+	public constructor(file: File, writer: OutputWriter) {
 		this.file = file;
 		this.writer = writer;
 	}
@@ -103,7 +159,7 @@ export class FileWriter {
 		return this.file;
 	}
 
-	public getWriter(): StreamWriter {
+	public getWriter(): OutputWriter {
 		return this.writer;
 	}
 
@@ -131,6 +187,7 @@ export class Library {
 	private readonly globals: Array<Global> = new Array;
 	private globalIncludes: Array<Include> = new Array;
 	private readonly typescriptFiles: Array<string> = new Array;
+	private readonly inputFiles: Set<string> = new Set;
 
 	public constructor(defaultName: string, typescriptFiles: ReadonlyArray<string>) {
 		this.defaultFile = new File(defaultName);
@@ -176,14 +233,98 @@ export class Library {
 		return this.typescriptFiles;
 	}
 
+	// Every file that was read to generate the library, including files
+	// that no written declaration comes from, because they can still change
+	// the output.
+	public getInputFiles(): ReadonlyArray<string> {
+		return [...this.inputFiles].sort();
+	}
+
+	public addInputFile(file: string): void {
+		this.inputFiles.add(file);
+	}
+
 	public hasFile(file: string): boolean {
 		return this.typescriptFiles.includes(realpath(file));
 	}
 
+	public includesDeclaration(declaration: Declaration): boolean {
+		const file = declaration.getFile();
+		return !file || this.hasFile(file);
+	}
+
 	public removeDuplicates(): void {
 		this.globals.splice(0, this.globals.length, ...removeDuplicates(this.globals));
 	}
 
+	// Compute the globals that are needed to write the roots, together with
+	// the state that they must be written in. Like in the dependency resolver,
+	// a dependency on a declaration that is not a global is a dependency on
+	// the complete form of the global that contains it.
+	public getClosure(roots: ReadonlyArray<[Declaration, State]>): Map<Declaration, State> {
+		const targets = new Set(this.globals.map(global => global.getDeclaration()));
+		const closure = new Map<Declaration, State>;
+		const stack = [...roots];
+		let entry;
+
+		while ((entry = stack.pop())) {
+			const [declaration, state] = entry;
+			const oldState = closure.get(declaration);
+
+			if (oldState !== undefined && oldState >= state) {
+				continue;
+			}
+
+			closure.set(declaration, state);
+
+			let parent = declaration.getParentDeclaration();
+
+			while (parent && !targets.has(parent)) {
+				parent = parent.getParentDeclaration();
+			}
+
+			if (parent) {
+				stack.push([parent, State.Complete]);
+			}
+
+			for (const [dependencyDeclaration, dependency] of declaration.getDependencies(state)) {
+				let target: Declaration | undefined = dependencyDeclaration;
+				let targetState = dependency.getState();
+
+				while (target && !targets.has(target)) {
+					target = target.getParentDeclaration();
+					targetState = State.Complete;
+				}
+
+				if (target) {
+					stack.push([target, Math.min(targetState, target.maxState())]);
+				}
+			}
+		}
+
+		return closure;
+	}
+
+	// Only keep the globals in `closure`, and write them in the state that
+	// they are needed in. Classes that are only needed in partial form are
+	// written as forward declarations.
+	public restrict(closure: ReadonlyMap<Declaration, State>): void {
+		const globals = this.globals.filter(global => closure.has(global.getDeclaration()));
+		let partialCount = 0;
+
+		for (const global of globals) {
+			const state = closure.get(global.getDeclaration())!;
+			global.setTargetState(state);
+
+			if (state < global.getDeclaration().maxState()) {
+				partialCount += 1;
+			}
+		}
+
+		console.log(`kept ${globals.length} of ${this.globals.length} declarations (${partialCount} forward declared), dropped ${this.globals.length - globals.length}`);
+		this.globals.splice(0, this.globals.length, ...globals);
+	}
+
 	private static getFileOrder(files: Array<File>, file: File): void {
 		if (!files.includes(file)) {
 			for (const include of file.getIncludes()) {
@@ -200,7 +341,108 @@ export class Library {
 		}
 	}
 
+	// Create a file for every top-level class or namespace. The file includes
+	// the files of declarations that it depends on completely, and forward
+	// declares classes that it only depends on partially. The existing files
+	// become umbrella headers that include the files of their declarations.
+	public split(): void {
+		const files = [...this.files.values()];
+		const baseName = getBaseName(this.defaultFile);
+		const targets = new Set(this.globals.map(global => global.getDeclaration()));
+		const units = new Map<string, File>;
+		const names = new Set<string>;
+
+		const systemIncludes = new Set(
+			files
+				.flatMap(file => file.getIncludes())
+				.filter(include => include.isSystem())
+				.map(include => include.getName())
+		);
+
+		for (const global of this.globals) {
+			const declaration = global.getDeclaration();
+			const unitName = getUnit(declaration).getPath();
+
+			if (!this.includesDeclaration(declaration) || units.has(unitName)) {
+				continue;
+			}
+
+			let name = `${baseName}/${unitName.replace(/::/g, "/")}`;
+
+			// `Document` and `document` must not map to the same file on
+			// case-insensitive file systems.
+			while (names.has(name.toLowerCase())) {
+				name += "_";
+			}
+
+			names.add(name.toLowerCase());
+
+			const file = this.addFile(`${name}.h`);
+			const parent = files.find(file => file.getNames().includes(unitName)) ?? this.defaultFile;
+			file.addName(unitName);
+
+			for (const include of systemIncludes) {
+				file.addInclude(include, true);
+			}
+
+			// Hand-written headers of the parent, such as `function.h`, are
+			// not generated, so no dependency will ever include them.
+			for (const include of parent.getIncludes()) {
+				const includeName = path.posix.join(path.posix.dirname(parent.getName()), include.getName());
+
+				if (!include.isSystem() && !this.files.has(includeName)) {
+					file.addInclude(getRelativePath(file.getName(), includeName), false, include.getFile());
+				}
+			}
+
+			parent.addInclude(getRelativePath(parent.getName(), file.getName()), false, file);
+			units.set(unitName, file);
+		}
+
+		for (const global of this.globals) {
+			const declaration = global.getDeclaration();
+
+			if (!this.includesDeclaration(declaration)) {
+				continue;
+			}
+
+			const file = units.get(getUnit(declaration).getPath())!;
+
+			for (const [dependencyDeclaration, dependency] of declaration.getDependencies(global.getTargetState())) {
+				let target: Declaration | undefined = dependencyDeclaration;
+				let state = dependency.getState();
+
+				while (target && !targets.has(target)) {
+					target = target.getParentDeclaration();
+					state = State.Complete;
+				}
+
+				if (!target || !this.includesDeclaration(target)) {
+					continue;
+				}
+
+				const targetFile = units.get(getUnit(target).getPath())!;
+
+				if (targetFile === file) {
+					continue;
+				}
+
+				if (state === State.Complete || target.maxState() === State.Partial || target.getParentDeclaration()) {
+					if (!file.includesFile(targetFile)) {
+						file.addInclude(getRelativePath(file.getName(), targetFile.getName()), false, targetFile);
+					}
+				} else {
+					file.addForwardDeclaration(target);
+				}
+			}
+		}
+	}
+
 	public write(options?: Partial<Options>): void {
+		if (useSplit()) {
+			this.split();
+		}
+
 		new LibraryWriter(this, options).write();
 	}
 }
@@ -212,16 +454,20 @@ export class LibraryWriter {
 	private readonly defaultWriter: FileWriter;
 	private readonly globals: Array<Global> = new Array;
 	private readonly fileOrder: Array<File> = new Array;
+	private readonly options?: Partial<Options>;
+	private externTemplates: Array<TemplateType> = new Array;
 
 	public constructor(library: Library, options?: Partial<Options>) {
 		const defaultFile = library.getDefaultFile();
 		let defaultWriter: FileWriter | undefined;
 
 		for (const [name, file] of library.getFiles()) {
-			const writer = new StreamWriter(name, options);
+			const writer = new OutputWriter(name, options);
 			const fileWriter = new FileWriter(file, writer);
 			this.writers.push(fileWriter);
 
+			// In split mode, the names of the split files are added last, so
+			// they replace the names of the umbrella headers.
 			for (const declarationName of file.getNames()) {
 				this.writerMap.set(declarationName, fileWriter);
 			}
@@ -232,6 +478,7 @@ export class LibraryWriter {
 		}
 
 		this.library = library;
+		this.options = options;
 		this.defaultWriter = defaultWriter!;
 		this.globals = [...library.getGlobals()];
 
@@ -273,61 +520,151 @@ export class LibraryWriter {
 	}
 
 	private getWriter(global: Global): FileWriter {
-		return this.writerMap.get(global.getDeclaration().getPath()) ?? this.defaultWriter;
+		const declaration = global.getDeclaration();
+		const name = useSplit() ? getUnit(declaration).getPath() : declaration.getPath();
+		return this.writerMap.get(name) ?? this.defaultWriter;
 	}
 
-	public write() {
-		let index = 0;
+	public write(): void {
+		this.externTemplates = this.getExternTemplates(getExternTemplateCount());
+
+		try {
+			if (useSplit()) {
+				this.writeSplitFiles();
+			} else {
+				this.writeFiles();
+			}
+
+			this.writeForwardFile();
+
+			const moduleName = getModuleName();
+
+			if (moduleName) {
+				this.writeModuleFile(moduleName);
+			}
+
+			if (usePch()) {
+				this.writePchFiles();
+			}
+
+			if (useOutOfLine() || this.externTemplates.length > 0) {
+				this.writeSourceFile();
+			}
+		} catch (error) {
+			for (const fileWriter of this.writers) {
+				fileWriter.getWriter().discard();
+			}
+
+			throw error;
+		}
 
 		for (const fileWriter of this.writers) {
-			const writer = fileWriter.getWriter();
-			const file = fileWriter.getFile();
-			const includes = file.getIncludes()
-				.concat(this.library.getGlobalIncludes());
-			const guard = file.getName()
-				.replace(/[\/\.]/g, "_")
-				.toUpperCase();
-
-			writer.write("#ifndef");
-			writer.writeSpace();
-			writer.write(guard);
-			writer.writeLine();
-			writer.write("#define");
-			writer.writeSpace();
-			writer.write(guard);
-			writer.writeLine();
+			if (fileWriter.getWriter().commit()) {
+				console.log(`updated ${fileWriter.getFile().getName()}`);
+			} else if (isVerbose()) {
+				console.log(`unchanged ${fileWriter.getFile().getName()}`);
+			}
+		}
 
-			for (const include of includes) {
-				writer.write("#include");
-				writer.writeSpace(false);
+		const depfile = getDepfile();
 
-				if (include.isSystem()) {
-					writer.write("<");
-					writer.write(include.getName());
-					writer.write(">");
+		if (depfile) {
+			this.writeDepfile(depfile);
+		}
+	}
+
+	private writeGuard(fileWriter: FileWriter): void {
+		const writer = fileWriter.getWriter();
+		const guard = fileWriter.getFile().getName()
+			.replace(/[\/\.]/g, "_")
+			.toUpperCase();
+
+		writer.write("#ifndef");
+		writer.writeSpace();
+		writer.write(guard);
+		writer.writeLine();
+		writer.write("#define");
+		writer.writeSpace();
+		writer.write(guard);
+		writer.writeLine();
+	}
+
+	private writeHeader(fileWriter: FileWriter): void {
+		const writer = fileWriter.getWriter();
+		const file = fileWriter.getFile();
+		const defaultDirectory = path.posix.dirname(this.library.getDefaultFile().getName());
+
+		// Non-system global includes are relative to the default file, but
+		// split files are in a different directory.
+		const includes = file.getIncludes()
+			.concat(this.library.getGlobalIncludes().map(include => {
+				if (include.isSystem() || !useSplit()) {
+					return include;
 				} else {
-					writer.write("\"");
-					writer.write(include.getName());
-					writer.write("\"");
+					const name = getRelativePath(file.getName(), path.posix.join(defaultDirectory, include.getName()));
+					return new Include(name, false, include.getFile());
 				}
-
-				writer.writeLine();
+			}));
+
+		this.writeGuard(fileWriter);
+
+		for (const include of includes) {
+			writer.write("#include");
+			writer.writeSpace(false);
+
+			if (include.isSystem()) {
+				writer.write("<");
+				writer.write(include.getName());
+				writer.write(">");
+			} else {
+				writer.write("\"");
+				writer.write(include.getName());
+				writer.write("\"");
 			}
+
+			writer.writeLine();
+		}
+	}
+
+	private writeFooter(fileWriter: FileWriter): void {
+		const writer = fileWriter.getWriter();
+
+		if (fileWriter === this.defaultWriter) {
+			this.writeExternTemplates(fileWriter, true);
+		}
+
+		fileWriter.writeNamespaceChange(undefined);
+		writer.writeLineStart();
+		writer.write("#endif");
+		writer.writeLine();
+	}
+
+	private writeFiles(): void {
+		const writers = [...this.writers];
+		const shardCount = getShardCount();
+		const shardEntries = new Array<[Global, State]>;
+		let index = 0;
+
+		for (const fileWriter of writers) {
+			this.writeHeader(fileWriter);
 		}
 
 		resolveDependencies(this.globals, (global, state) => {
-			while (this.writers[index].isDone()) {
+			while (writers[index].isDone()) {
 				index += 1;
 			}
 
-			const fileWriter = this.writers[index];
+			const fileWriter = writers[index];
 			const declaration = global.getDeclaration();
 			const namespace = declaration.getNamespace();
-			const file = declaration.getFile();
 			
-			if (!file || this.library.hasFile(file)) {
-				fileWriter.writeNamespaceChange(namespace);
-				declaration.write(fileWriter.getWriter(), state, namespace);
+			if (this.library.includesDeclaration(declaration)) {
+				if (shardCount > 1 && fileWriter === this.defaultWriter) {
+					shardEntries.push([global, state]);
+				} else {
+					fileWriter.writeNamespaceChange(namespace);
+					declaration.write(fileWriter.getWriter(), state, namespace);
+				}
 			}
 			
 			if (state >= global.getTargetState()) {
@@ -335,12 +672,436 @@ export class LibraryWriter {
 			}
 		});
 
+		if (shardEntries.length > 0) {
+			this.writeShards(shardEntries, shardCount);
+		}
+
+		for (const fileWriter of writers) {
+			this.writeFooter(fileWriter);
+		}
+	}
+
+	// Split the declarations of the default file into `count` shards of
+	// roughly equal size. The declarations are kept in resolved order, and
+	// every shard includes the previous one, so that a prefix of the shards
+	// is always self-contained. The default file includes the last shard.
+	private writeShards(entries: ReadonlyArray<[Global, State]>, count: number): void {
+		const defaultFile = this.library.getDefaultFile();
+		const baseName = getBaseName(defaultFile);
+		const sizes = entries.map(([global, state]) => {
+			// Writing a class resolves its members, their states are restored
+			// so that the real write below still writes them.
+			const writer = new StringWriter(this.options);
+			const declaration = global.getDeclaration();
+			const descendants = getDescendants(declaration);
+			const states = descendants.map(descendant => descendant.getState());
+			declaration.write(writer, state, declaration.getNamespace());
+			descendants.forEach((descendant, i) => descendant.setState(states[i]));
+			return writer.getString().length;
+		});
+
+		const totalSize = sizes.reduce((a, b) => a + b, 0);
+		let size = 0;
+		let fileWriter: FileWriter | undefined;
+
+		for (let i = 0, shard = 0; i < entries.length; i++) {
+			if (!fileWriter || (size >= totalSize * shard / count && shard < count)) {
+				const file = new File(`${baseName}_${shard}.h`);
+
+				if (fileWriter) {
+					this.writeFooter(fileWriter);
+					file.addInclude(getRelativePath(file.getName(), fileWriter.getFile().getName()), false, fileWriter.getFile());
+				} else {
+					for (const include of defaultFile.getIncludes()) {
+						file.addInclude(include.getName(), include.isSystem(), include.getFile());
+					}
+				}
+
+				fileWriter = new FileWriter(file, new OutputWriter(file.getName(), this.options));
+				this.writers.push(fileWriter);
+				this.writeHeader(fileWriter);
+				shard += 1;
+			}
+
+			const [global, state] = entries[i];
+			const declaration = global.getDeclaration();
+			const namespace = declaration.getNamespace();
+			fileWriter.writeNamespaceChange(namespace);
+			declaration.write(fileWriter.getWriter(), state, namespace);
+			size += sizes[i];
+		}
+
+		this.writeFooter(fileWriter!);
+
+		const writer = this.defaultWriter.getWriter();
+		this.defaultWriter.writeNamespaceChange(undefined);
+		writer.writeLineStart();
+		writer.write("#include");
+		writer.writeSpace(false);
+		writer.write("\"");
+		writer.write(getRelativePath(defaultFile.getName(), fileWriter!.getFile().getName()));
+		writer.write("\"");
+		writer.writeLine();
+	}
+
+	// Every split file is resolved on its own, dependencies on other files
+	// are already satisfied by their includes and forward declarations.
+	private writeSplitFiles(): void {
+		const fileGlobals = new Map<FileWriter, Array<Global>>;
+
+		for (const global of this.globals) {
+			if (this.library.includesDeclaration(global.getDeclaration())) {
+				const fileWriter = this.getWriter(global);
+				const globals = fileGlobals.get(fileWriter);
+
+				if (globals) {
+					globals.push(global);
+				} else {
+					fileGlobals.set(fileWriter, [global]);
+				}
+			}
+		}
+
 		for (const fileWriter of this.writers) {
 			const writer = fileWriter.getWriter();
-			fileWriter.writeNamespaceChange(undefined);
-			writer.writeLineStart();
-			writer.write("#endif");
+			this.writeHeader(fileWriter);
+
+			for (const declaration of fileWriter.getFile().getForwardDeclarations()) {
+				const namespace = declaration.getNamespace();
+				fileWriter.writeNamespaceChange(namespace);
+				declaration.write(writer, State.Partial, namespace);
+			}
+
+			resolveDependencies(fileGlobals.get(fileWriter) ?? [], (global, state) => {
+				const declaration = global.getDeclaration();
+				const namespace = declaration.getNamespace();
+				fileWriter.writeNamespaceChange(namespace);
+				declaration.write(writer, state, namespace);
+			});
+
+			this.writeFooter(fileWriter);
+		}
+	}
+
+	// Write `<base>_fwd.h`, which only forward declares every namespace-scope
+	// class. Headers that only use pointers to client classes can include it
+	// instead of the full headers.
+	private writeForwardFile(): void {
+		const file = new File(`${getBaseName(this.library.getDefaultFile())}_fwd.h`);
+		const fileWriter = new FileWriter(file, new OutputWriter(file.getName(), this.options));
+		const writer = fileWriter.getWriter();
+		this.writers.push(fileWriter);
+		this.writeGuard(fileWriter);
+
+		for (const global of this.globals) {
+			const declaration = global.getDeclaration();
+
+			if (declaration instanceof Class && !declaration.getParentDeclaration() && this.library.includesDeclaration(declaration)) {
+				const namespace = declaration.getNamespace();
+				fileWriter.writeNamespaceChange(namespace);
+				declaration.write(writer, State.Partial, namespace);
+			}
+		}
+
+		this.writeFooter(fileWriter);
+	}
+
+	// Write `<base>.cppm`, a module interface unit that includes the headers
+	// in its global module fragment and exports every namespace-scope name
+	// with a using declaration.
+	private writeModuleFile(moduleName: string): void {
+		const defaultFile = this.library.getDefaultFile();
+		const file = new File(`${getBaseName(defaultFile)}.cppm`);
+		const fileWriter = new FileWriter(file, new OutputWriter(file.getName(), this.options));
+		const writer = fileWriter.getWriter();
+		const namespaceNames = new Map<string, Set<string>>;
+		this.writers.push(fileWriter);
+
+		for (const global of this.globals) {
+			const declaration = global.getDeclaration();
+			const namespace = declaration.getNamespace();
+
+			if (namespace && !declaration.getParentDeclaration() && this.library.includesDeclaration(declaration)) {
+				const namespacePath = namespace.getPath();
+				const names = namespaceNames.get(namespacePath);
+
+				if (names) {
+					names.add(declaration.getName());
+				} else {
+					namespaceNames.set(namespacePath, new Set([declaration.getName()]));
+				}
+
+			}
+		}
+
+		writer.write("module;");
+		writer.writeLine();
+		writer.write("#include");
+		writer.writeSpace(false);
+		writer.write("\"");
+		writer.write(getRelativePath(file.getName(), defaultFile.getName()));
+		writer.write("\"");
+		writer.writeLine();
+		writer.write("export module");
+		writer.writeSpace();
+		writer.write(moduleName);
+		writer.write(";");
+		writer.writeLine();
+
+		for (const [namespacePath, names] of namespaceNames) {
+			writer.write("export namespace");
+			writer.writeSpace();
+			writer.write(namespacePath);
+			writer.writeBlockOpen();
+
+			for (const name of names) {
+				writer.write("using");
+				writer.writeSpace();
+				writer.write(`${namespacePath}::${name}`);
+				writer.write(";");
+				writer.writeLine(false);
+			}
+
+			writer.writeBlockClose();
+		}
+	}
+
+	// Write `<base>_pch.h`, a prefix header that includes all generated
+	// headers, and `<base>_pch.cmake`, which defines a function that adds it
+	// as a precompiled header to a target.
+	private writePchFiles(): void {
+		const defaultFile = this.library.getDefaultFile();
+		const baseName = getBaseName(defaultFile);
+		const file = new File(`${baseName}_pch.h`);
+		const cmakeFile = new File(`${baseName}_pch.cmake`);
+		const fileWriter = new FileWriter(file, new OutputWriter(file.getName(), this.options));
+		const cmakeFileWriter = new FileWriter(cmakeFile, new OutputWriter(cmakeFile.getName(), this.options));
+		const writer = fileWriter.getWriter();
+		const cmakeWriter = cmakeFileWriter.getWriter();
+		const functionName = `${path.posix.basename(baseName).replace(/\W/g, "_")}_precompile_headers`;
+		this.writers.push(fileWriter, cmakeFileWriter);
+
+		this.writeGuard(fileWriter);
+		writer.write("#include");
+		writer.writeSpace(false);
+		writer.write("\"");
+		writer.write(getRelativePath(file.getName(), defaultFile.getName()));
+		writer.write("\"");
+		writer.writeLine();
+		this.writeFooter(fileWriter);
+
+		for (const line of [
+			`function(${functionName} target)`,
+			`\ttarget_precompile_headers(\${target} PRIVATE "\${CMAKE_CURRENT_FUNCTION_LIST_DIR}/${path.posix.basename(file.getName())}")`,
+			"endfunction()",
+		]) {
+			cmakeWriter.write(line);
+			cmakeWriter.writeLine();
+		}
+	}
+
+	// Functions that are written in the headers, members of classes are only
+	// written when the class is complete.
+	private static getFunctions(declaration: Declaration, complete: boolean, functions: Array<Function>): void {
+		if (declaration instanceof Function) {
+			functions.push(declaration);
+		} else if (declaration instanceof Class && complete) {
+			for (const child of declaration.getChildren()) {
+				LibraryWriter.getFunctions(child, child.isReferenced(), functions);
+			}
+		}
+	}
+
+	// Write `<base>.cpp`, which contains the definitions of the functions
+	// that are only declared in the headers with `--out-of-line`. It must be
+	// compiled once and linked with the program.
+	private writeSourceFile(): void {
+		const defaultFile = this.library.getDefaultFile();
+		const file = new File(`${getBaseName(defaultFile)}.cpp`);
+		const fileWriter = new FileWriter(file, new OutputWriter(file.getName(), this.options));
+		const writer = fileWriter.getWriter();
+		const functions = new Array<Function>;
+		this.writers.push(fileWriter);
+
+		for (const global of this.globals) {
+			const declaration = global.getDeclaration();
+
+			if (this.library.includesDeclaration(declaration)) {
+				LibraryWriter.getFunctions(declaration, global.getTargetState() === State.Complete, functions);
+			}
+		}
+
+		writer.write("#include");
+		writer.writeSpace(false);
+		writer.write("\"");
+		writer.write(getRelativePath(file.getName(), defaultFile.getName()));
+		writer.write("\"");
+		writer.writeLine();
+
+		for (const declaration of functions) {
+			if (declaration.isOutOfLine()) {
+				const namespace = declaration.getNamespace();
+				fileWriter.writeNamespaceChange(namespace);
+				declaration.writeDefinition(writer, namespace);
+			}
+		}
+
+		this.writeExternTemplates(fileWriter, false);
+		fileWriter.writeNamespaceChange(undefined);
+	}
+
+	// Find the instantiations of class templates in the types of the
+	// declarations that are written, ignoring those that depend on template
+	// parameters.
+	private static getTemplateTypes(expression: Expression, scope: ReadonlySet<string>, types: Array<TemplateType>): void {
+		if (expression instanceof TemplateType) {
+			const inner = expression.getInner();
+
+			if (inner instanceof DeclaredType && inner.getDeclaration() instanceof Class && ![...expression.getNamedTypes()].some(name => scope.has(name))) {
+				types.push(expression);
+			}
+		}
+
+		for (const child of expression.getChildren()) {
+			LibraryWriter.getTemplateTypes(child, scope, types);
+		}
+	}
+
+	private static getDeclarationTemplateTypes(declaration: Declaration, complete: boolean, scope: ReadonlySet<string>, types: Array<TemplateType>): void {
+		const newScope = new Set(scope);
+
+		if (declaration instanceof TemplateDeclaration) {
+			for (const typeParameter of declaration.getTypeParameters()) {
+				newScope.add(typeParameter.getName());
+			}
+		}
+
+		if (declaration instanceof Function) {
+			for (const parameter of declaration.getParameters()) {
+				LibraryWriter.getTemplateTypes(parameter.getType(), newScope, types);
+			}
+
+			const type = declaration.getType();
+
+			if (type) {
+				LibraryWriter.getTemplateTypes(type, newScope, types);
+			}
+		} else if (declaration instanceof Variable || declaration instanceof TypeAlias) {
+			LibraryWriter.getTemplateTypes(declaration.getType(), newScope, types);
+		} else if (declaration instanceof Class && complete) {
+			for (const base of declaration.getBases()) {
+				LibraryWriter.getTemplateTypes(base.getType(), newScope, types);
+			}
+
+			// Constraints are value expressions, their instantiations are
+			// found through `ValueExpression.getChildren`.
+			if (useConstraints()) {
+				for (const constraint of declaration.getConstraints()) {
+					LibraryWriter.getTemplateTypes(constraint, newScope, types);
+				}
+			}
+
+			for (const child of declaration.getChildren()) {
+				LibraryWriter.getDeclarationTemplateTypes(child, child.isReferenced(), newScope, types);
+			}
+		}
+	}
+
+	// The `count` most frequently used instantiations of class templates that
+	// are written complete. These are declared `extern` at the end of the
+	// default file, and explicitly instantiated in the companion source file,
+	// so that they are only instantiated once.
+	private getExternTemplates(count: number): Array<TemplateType> {
+		if (count <= 0) {
+			return new Array;
+		}
+
+		const types = new Array<TemplateType>;
+		const counts = new Map<string, [TemplateType, number]>;
+		const completeTemplates = new Set<Declaration>;
+
+		for (const global of this.globals) {
+			const declaration = global.getDeclaration();
+			const complete = global.getTargetState() === State.Complete;
+
+			if (this.library.includesDeclaration(declaration)) {
+				LibraryWriter.getDeclarationTemplateTypes(declaration, complete, new Set, types);
+
+				if (declaration instanceof Class && declaration.getTypeParameters().length > 0 && complete) {
+					completeTemplates.add(declaration);
+				}
+			}
+		}
+
+		for (const type of types) {
+			const declaration = (type.getInner() as DeclaredType).getDeclaration();
+
+			if (completeTemplates.has(declaration)) {
+				const key = type.key();
+				const entry = counts.get(key);
+
+				if (entry) {
+					entry[1] += 1;
+				} else {
+					counts.set(key, [type, 1]);
+				}
+			}
+		}
+
+		return [...counts.values()]
+			.sort((a, b) => b[1] - a[1])
+			.slice(0, count)
+			.map(([type]) => type);
+	}
+
+	private writeExternTemplates(fileWriter: FileWriter, declaration: boolean): void {
+		const writer = fileWriter.getWriter();
+
+		for (const type of this.externTemplates) {
+			const namespace = (type.getInner() as DeclaredType).getDeclaration().getNamespace();
+			fileWriter.writeNamespaceChange(namespace);
+
+			if (declaration) {
+				writer.write("extern");
+				writer.writeSpace();
+			}
+
+			writer.write("template");
+			writer.writeSpace();
+			writer.write("class");
+			writer.writeSpace();
+			type.write(writer, namespace);
+			writer.write(";");
+			writer.writeLine(false);
+		}
+	}
+
+	private static escapeDepfilePath(path: string): string {
+		return path
+			.replace(/\$/g, "$$$$")
+			.replace(/([ #])/g, "\\$1");
+	}
+
+	// Write a Makefile-style dependency file, listing for every generated
+	// file all the input files of the library.
+	private writeDepfile(path: string): void {
+		const writer = new OutputWriter(path);
+		const inputFiles = this.library.getInputFiles();
+
+		for (const fileWriter of this.writers) {
+			writer.write(LibraryWriter.escapeDepfilePath(fileWriter.getFile().getName()));
+			writer.write(":");
+
+			for (const sourceFile of inputFiles) {
+				writer.write(" \\");
+				writer.writeLine();
+				writer.write(" ");
+				writer.write(LibraryWriter.escapeDepfilePath(sourceFile));
+			}
+
 			writer.writeLine();
 		}
+
+		writer.commit();
 	}
 }
@@ -94,11 +94,11 @@ export class Namespace {
 		}
 	}
 
-	public writeAttributes(writer: Writer): void {
+	public writeAttributes(writer: Writer, attributes: ReadonlyArray<string> = this.attributes): void {
 		let first = true;
 		writer.write("[[");
 
-		for (const attribute of this.attributes) {
+		for (const attribute of attributes) {
 			if (!first) {
 				writer.write(",");
 				writer.writeSpace(false);
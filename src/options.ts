@@ -24,19 +24,39 @@ export function parseOptions() {
 	program
 		.option("--pretty")
 		.option("--default-lib")
+		.option("--lib <names>", "", (value: string) => value.split(",").map(name => name.trim()).filter(name => name !== ""))
 		.option("--out, -o <file>")
 		.option("--ignore-errors")
 		.option("--list-files")
 		.option("--verbose, -v")
 		.option("--namespace <namespace>")
 		.option("--no-constraints")
-		.option("--full-names");
+		.option("--full-names")
+		.option("--depfile <path>")
+		.option("--split")
+		.option("--module <name>")
+		.option("--pch")
+		.option("--shards <count>", "", parseInt)
+		.option("--used-by <dir>")
+		.option("--out-of-line")
+		.option("--extern-templates <count>", "", parseInt)
+		.option("--root <path>", "", (value: string, previous: Array<string>) => previous.concat([value]), []);
 
 	program.parse();
 
 	options = program.opts();
 }
 
+// `--lib` selects a subset of the default library, so it implies
+// `--default-lib`.
+export function useDefaultLib(): boolean {
+	return !!options.defaultLib || !!options.lib;
+}
+
+export function getLibs(): ReadonlyArray<string> | undefined {
+	return options.lib;
+}
+
 export function isVerbose(): boolean {
 	return !!options.V;
 }
@@ -52,3 +72,39 @@ export function useConstraints(): boolean {
 export function useFullNames(): boolean {
 	return !!options.fullNames;
 }
+
+export function useSplit(): boolean {
+	return !!options.split;
+}
+
+export function usePch(): boolean {
+	return !!options.pch;
+}
+
+export function getShardCount(): number {
+	return options.shards ?? 1;
+}
+
+export function getUsedBy(): string | undefined {
+	return options.usedBy;
+}
+
+export function getRoots(): ReadonlyArray<string> {
+	return options.root;
+}
+
+export function useOutOfLine(): boolean {
+	return !!options.outOfLine;
+}
+
+export function getExternTemplateCount(): number {
+	return options.externTemplates ?? 0;
+}
+
+export function getDepfile(): string | undefined {
+	return options.depfile;
+}
+
+export function getModuleName(): string | undefined {
+	return options.module;
+}
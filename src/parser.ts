@@ -114,6 +114,12 @@ export class Parser {
 		this.functionBuiltin = this.getBuiltinType("Function");
 		this.eventListenerBuiltin = this.getBuiltinType("EventListener");
 
+		// Without lib.dom or lib.webworker nothing declares `EventListener`,
+		// but callbacks and `cheerp/client.h` still use it.
+		if (defaultLib && !this.eventListenerBuiltin.classObj) {
+			this.eventListenerBuiltin = this.createStubClass("EventListener", namespace);
+		}
+
 		const generateTimer = new Timer("generate");
 
 		if (options.namespace) {
@@ -219,6 +225,18 @@ export class Parser {
 		}
 	}
 
+	private createStubClass(name: string, namespace: Namespace): BuiltinType {
+		const classObj = new Class(name, namespace);
+		classObj.addBase(this.objectBuiltin.type, Visibility.Public);
+		this.classes.push(classObj);
+		this.library.addGlobal(classObj);
+
+		return {
+			classObj: classObj,
+			type: new DeclaredType(classObj),
+		};
+	}
+
 	private getTypeParameter(types: TypeMap, type: ts.TypeParameter, id: number): NamedType {
 		let result = types.get(type);
 
@@ -19,6 +19,10 @@ export abstract class Expression {
 	public abstract write(writer: Writer, namespace?: Namespace): void;
 	public abstract key(): string;
 
+	public getChildren(): ReadonlyArray<Expression> {
+		return new Array;
+	}
+
 	public isAlwaysTrue(): boolean {
 		return false;
 	}
@@ -433,6 +437,10 @@ export class MemberType extends UnqualifiedType {
 		return this.name;
 	}
 
+	public getChildren(): ReadonlyArray<Expression> {
+		return [this.inner];
+	}
+
 	public getDependencies(reason: Dependency, innerState?: State): Dependencies {
 		return this.inner.getDependencies(reason.withState(State.Complete));
 	}
@@ -472,6 +480,10 @@ export class QualifiedType extends Type {
 		return this.qualifier;
 	}
 
+	public getChildren(): ReadonlyArray<Expression> {
+		return [this.inner];
+	}
+
 	public getDependencies(reason: Dependency, innerState?: State): Dependencies {
 		if (this.qualifier & (TypeQualifier.Pointer | TypeQualifier.Reference | TypeQualifier.RValueReference)) {
 			return this.inner.getDependencies(reason.withState(innerState ?? State.Partial), innerState);
@@ -543,6 +555,10 @@ export class TemplateType extends Type {
 		this.typeParameters.push(typeParameter);
 	}
 
+	public getChildren(): ReadonlyArray<Expression> {
+		return [this.inner, ...this.typeParameters];
+	}
+
 	public getDependencies(reason: Dependency, innerState?: State): Dependencies {
 		let hasConstraints = false;
 		let state: State | undefined = undefined;
@@ -639,6 +655,10 @@ export class FunctionType extends Type {
 		this.parameters.push(parameter);
 	}
 
+	public getChildren(): ReadonlyArray<Expression> {
+		return [this.returnType, ...this.parameters];
+	}
+
 	public getDependencies(reason: Dependency, innerState?: State): Dependencies {
 		const partialReason = reason.withState(State.Partial);
 
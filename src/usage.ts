@@ -0,0 +1,155 @@
+import { Library } from "./library.js";
+import { Declaration } from "./declaration.js";
+import { Class } from "./class.js";
+import { DeclaredType } from "./type.js";
+import { State } from "./target.js";
+import { program } from "commander";
+import * as fs from "fs";
+import * as path from "path";
+
+const SOURCE_EXTENSIONS = [
+	".c", ".cc", ".cpp", ".cxx", ".c++",
+	".h", ".hh", ".hpp", ".hxx", ".h++", ".inl",
+	".cppm", ".ixx",
+];
+
+const COMMENT_OR_STRING = /\/\/[^\n]*|\/\*[\s\S]*?\*\/|"(?:\\.|[^"\\\n])*"|'(?:\\.|[^'\\\n])*'/g;
+const USING_NAMESPACE = /\busing\s+namespace\s+((?:::\s*)?[A-Za-z_]\w*(?:\s*::\s*[A-Za-z_]\w*)*)\s*;/g;
+const QUALIFIED_NAME = /(?:::\s*)?[A-Za-z_]\w*(?:\s*::\s*[A-Za-z_]\w*)*/g;
+const MEMBER_CALL = /(?:->|\.)\s*([A-Za-z_]\w*)\s*\(/g;
+
+function getSourceFiles(dir: string, files: Array<string>, dirs: Array<string>): void {
+	dirs.push(dir);
+
+	for (const entry of fs.readdirSync(dir, { withFileTypes: true })) {
+		const file = path.join(dir, entry.name);
+
+		if (entry.isDirectory()) {
+			getSourceFiles(file, files, dirs);
+		} else if (SOURCE_EXTENSIONS.includes(path.extname(entry.name).toLowerCase())) {
+			files.push(file);
+		}
+	}
+}
+
+function normalizeName(name: string): string {
+	return name.replace(/\s+/g, "").replace(/^::/, "");
+}
+
+function hasMember(declaration: Class, names: ReadonlySet<string>): boolean {
+	return declaration.getChildren().some(child => names.has(child.getName())) ||
+		declaration.getBases().some(base => {
+			const type = base.getInnerType();
+			return type instanceof DeclaredType && type.getDeclaration() instanceof Class && hasMember(type.getDeclaration() as Class, names);
+		});
+}
+
+// Globals that are named by the library files, these are always kept because
+// the hand-written helpers in `jshelper.h` and the extensions use them.
+export function getFileRoots(library: Library): Array<[Declaration, State]> {
+	const names = new Set([...library.getFiles().values()].flatMap(file => file.getNames()));
+
+	return library.getGlobals()
+		.map(global => global.getDeclaration())
+		.filter(declaration => names.has(declaration.getPath()))
+		.map(declaration => [declaration, declaration.maxState()]);
+}
+
+// Find the declarations that are used by the C++ sources in `dir`, and by the
+// explicit `rootNames`. The sources are not parsed, every qualified name is
+// matched against the longest prefix that names a global, and in files with a
+// `using namespace` directive, so is every name prefixed with the namespace.
+// Calls to members of classes that would otherwise only be forward declared
+// make those classes complete.
+export function getUsedDeclarations(library: Library, dir: string | undefined, rootNames: ReadonlyArray<string>): Map<Declaration, State> {
+	const globalMap = new Map<string, Array<Declaration>>;
+	const roots = getFileRoots(library);
+	const memberNames = new Set<string>;
+	const files = new Array<string>;
+
+	for (const global of library.getGlobals()) {
+		const declaration = global.getDeclaration();
+		const globalPath = declaration.getPath();
+		const declarations = globalMap.get(globalPath);
+
+		if (declarations) {
+			declarations.push(declaration);
+		} else {
+			globalMap.set(globalPath, [declaration]);
+		}
+	}
+
+	const addRoot = (name: string) => {
+		const parts = name.split("::");
+
+		for (let i = parts.length; i > 0; i--) {
+			const declarations = globalMap.get(parts.slice(0, i).join("::"));
+
+			if (declarations) {
+				for (const declaration of declarations) {
+					roots.push([declaration, declaration.maxState()]);
+				}
+
+				break;
+			}
+		}
+	};
+
+	for (const name of rootNames) {
+		const declarations = globalMap.get(normalizeName(name));
+
+		if (!declarations) {
+			program.error(`error: unknown root [${name}]`);
+		}
+
+		for (const declaration of declarations) {
+			roots.push([declaration, declaration.maxState()]);
+		}
+	}
+
+	// Adding or removing a source file changes its directory, so the
+	// directories are inputs as well.
+	if (dir) {
+		const dirs = new Array<string>;
+		getSourceFiles(dir, files, dirs);
+
+		for (const file of [...dirs, ...files]) {
+			library.addInputFile(file);
+		}
+	}
+
+	for (const file of files) {
+		const source = fs.readFileSync(file, "utf-8").replace(COMMENT_OR_STRING, " ");
+		const namespaces = [...source.matchAll(USING_NAMESPACE)].map(match => normalizeName(match[1]));
+
+		for (const match of source.matchAll(QUALIFIED_NAME)) {
+			const name = normalizeName(match[0]);
+			addRoot(name);
+
+			for (const namespace of namespaces) {
+				addRoot(`${namespace}::${name}`);
+			}
+		}
+
+		for (const match of source.matchAll(MEMBER_CALL)) {
+			memberNames.add(match[1]);
+		}
+	}
+
+	let closure = library.getClosure(roots);
+
+	while (true) {
+		const promoted = [...closure]
+			.filter(([declaration, state]) => state === State.Partial && declaration instanceof Class && hasMember(declaration, memberNames));
+
+		if (promoted.length === 0) {
+			return closure;
+		}
+
+		for (const [declaration, state] of promoted) {
+			roots.push([declaration, State.Complete]);
+		}
+
+		closure = library.getClosure(roots);
+	}
+}
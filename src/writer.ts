@@ -1,5 +1,6 @@
 import * as fs from "fs";
-import { Writable } from "stream";
+import * as path from "path";
+import * as crypto from "crypto";
 
 export interface Options {
 	pretty: boolean;
@@ -93,19 +94,6 @@ export abstract class Writer {
 	}
 }
 
-export class StreamWriter extends Writer {
-	private readonly stream: Writable;
-
-	public constructor(path: fs.PathLike, options?: Partial<Options>) {
-		super(options);
-		this.stream = fs.createWriteStream(path);
-	}
-	
-	public writeStream(string: string): void {
-		this.stream.write(string);
-	}
-}
-
 export class StringWriter extends Writer {
 	private data: string = "";
 
@@ -117,3 +105,84 @@ export class StringWriter extends Writer {
 		return this.data;
 	}
 }
+
+export class OutputWriter extends Writer {
+	private static readonly BUFFER_SIZE: number = 1 << 16;
+
+	private readonly path: string;
+	private readonly tmpPath: string;
+	private fd?: number;
+	private readonly hash: crypto.Hash = crypto.createHash("sha256");
+	private buffer: string = "";
+
+	public constructor(path: string, options?: Partial<Options>) {
+		super(options);
+		this.path = path;
+		this.tmpPath = `${path}.${process.pid}.tmp`;
+	}
+
+	public getPath(): string {
+		return this.path;
+	}
+
+	public writeStream(string: string): void {
+		this.buffer += string;
+
+		if (this.buffer.length >= OutputWriter.BUFFER_SIZE) {
+			this.flush();
+		}
+	}
+
+	// The temporary file is only opened on the first flush, so that split mode
+	// does not keep a file descriptor open for every small header.
+	private flush(): void {
+		if (this.fd === undefined) {
+			fs.mkdirSync(path.dirname(this.path), { recursive: true });
+			this.fd = fs.openSync(this.tmpPath, "w");
+		}
+
+		this.hash.update(this.buffer);
+		fs.writeSync(this.fd, this.buffer);
+		this.buffer = "";
+	}
+
+	private static hashFile(path: string): string {
+		const hash = crypto.createHash("sha256");
+		const buffer = Buffer.alloc(OutputWriter.BUFFER_SIZE);
+		const fd = fs.openSync(path, "r");
+		let count;
+
+		try {
+			while ((count = fs.readSync(fd, buffer, 0, buffer.length, null)) > 0) {
+				hash.update(buffer.subarray(0, count));
+			}
+		} finally {
+			fs.closeSync(fd);
+		}
+
+		return hash.digest("hex");
+	}
+
+	// Output is streamed to a temporary file as it is generated. The file is
+	// only renamed over the old one when its contents changed, so that the
+	// mtime of unchanged files is preserved.
+	public commit(): boolean {
+		this.flush();
+		fs.closeSync(this.fd!);
+
+		if (fs.existsSync(this.path) && OutputWriter.hashFile(this.path) === this.hash.digest("hex")) {
+			fs.unlinkSync(this.tmpPath);
+			return false;
+		}
+
+		fs.renameSync(this.tmpPath, this.path);
+		return true;
+	}
+
+	public discard(): void {
+		if (this.fd !== undefined) {
+			fs.closeSync(this.fd);
+			fs.unlinkSync(this.tmpPath);
+		}
+	}
+}